@@ -0,0 +1,363 @@
+/*
+ * bench.c
+ * Microbenchmark the k/v store, without the socket.
+ * By J. Stuart McMurray
+ * Created 20261019
+ * Last Modified 20261019
+ */
+
+#include <err.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "tree.h"
+
+/* VALLEN is the length of the values we store. */
+#define VALLEN 32
+
+/* BATCH is the number of deletes we time at once before putting the deleted
+ * keys back. */
+#define BATCH 1024
+
+/* ZIPF_THETA is the skew of the Zipfian key distribution, as in YCSB. */
+#define ZIPF_THETA 0.99
+
+/* Default parameters. */
+#define DEF_OPS    1000000
+#define DEF_MAXMEM 2048 /* MB, enough for 10M 8-byte keys */
+
+/* Key access patterns. */
+enum pattern { SEQ, RAND, ZIPF, NPATTERNS };
+static const char *pnames[NPATTERNS] = { "seq", "rand", "zipf" };
+
+static size_t klens[] = { 8, 64, 256, 1024 };
+static size_t nkeys[] = { 1000, 10000, 100000, 1000000, 10000000 };
+
+static char          *keys;         /* Generated keys. */
+static size_t         klen;         /* Length of each of keys. */
+static size_t         allocs;       /* Allocations we've made for values. */
+static uint64_t       rstate;       /* PRNG state. */
+static volatile size_t sink;        /* Keeps the compiler honest. */
+
+void
+usage(void)
+{
+        fprintf(stderr, "Usage: %s [-h] [-k keylen] [-m maxmem] [-n nkeys] "
+                        "[-o ops]\n"
+"\n"
+"Microbenchmarks memkvd's key/value store.  By default, runs every\n"
+"combination of key length and store size which fits in maxmem.\n"
+"\n"
+"Flags:\n"
+"  -h        - This help\n"
+"  -k keylen - Only use keys of this length (8-1024)\n"
+"  -m maxmem - Skip runs needing more than this many MB (default: %d)\n"
+"  -n nkeys  - Only use stores with this many keys\n"
+"  -o ops    - Operations per benchmark (default: %d)\n",
+                        getprogname(), DEF_MAXMEM, DEF_OPS);
+        exit(1);
+}
+
+/* now returns the monotonic clock, in nanoseconds. */
+static long long
+now(void)
+{
+        struct timespec ts;
+
+        if (-1 == clock_gettime(CLOCK_MONOTONIC, &ts))
+                err(2, "clock_gettime");
+        return (long long)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* rnd returns a pseudorandom number.  It's seeded the same way every run, so
+ * runs are comparable. */
+static uint64_t
+rnd(void)
+{
+        rstate ^= rstate >> 12;
+        rstate ^= rstate << 25;
+        rstate ^= rstate >> 27;
+        return rstate * 0x2545F4914F6CDD1DULL;
+}
+
+/* key returns the ith key. */
+static char *
+key(size_t i)
+{
+        return keys + i * (klen + 1);
+}
+
+/* newval returns a freshly-allocated value, as if read from a client. */
+static char *
+newval(void)
+{
+        char *v;
+        uint16_t len;
+
+        if (NULL == (v = malloc(STRHDR + VALLEN + 1)))
+                err(3, "malloc");
+        len = VALLEN;
+        memcpy(v, &len, STRHDR);
+        memset(v + STRHDR, 'v', VALLEN);
+        v[STRHDR + VALLEN] = '\0';
+        ++allocs;
+        return v;
+}
+
+/* put adds or updates the ith key, terminating the program on error. */
+static void
+put(size_t i)
+{
+        if (-1 == tree_set(key(i), klen, newval(), VALLEN))
+                err(4, "tree_set");
+}
+
+/* count counts keys for tree_walk. */
+static int
+count(const char *key, void *n)
+{
+        (void)key;
+        ++*(size_t *)n;
+        return 0;
+}
+
+/* zipf fills idx with n Zipf-distributed indices into a store of nk keys,
+ * scrambled so the hot keys aren't all next to each other. */
+static void
+zipf(size_t *idx, size_t n, size_t nk)
+{
+        double alpha, eta, u, uz, zetan, zeta2;
+        size_t i, r;
+
+        zeta2 = 1 + pow(0.5, ZIPF_THETA);
+        for (zetan = 0, i = 1; i <= nk; ++i)
+                zetan += 1 / pow((double)i, ZIPF_THETA);
+        alpha = 1 / (1 - ZIPF_THETA);
+        eta = (1 - pow(2.0 / nk, 1 - ZIPF_THETA)) / (1 - zeta2 / zetan);
+
+        for (i = 0; i < n; ++i) {
+                u = (rnd() >> 11) / 9007199254740992.0; /* [0, 1) */
+                uz = u * zetan;
+                if (1 > uz)
+                        r = 0;
+                else if (zeta2 > uz)
+                        r = 1;
+                else
+                        r = nk * pow(eta * u - eta + 1, alpha);
+                if (nk <= r)
+                        r = nk - 1;
+                idx[i] = (r * 0x9E3779B97F4A7C15ULL) % nk;
+        }
+}
+
+/* indices fills idx with n indices into a store of nk keys, following the
+ * pattern p. */
+static void
+indices(size_t *idx, size_t n, size_t nk, enum pattern p)
+{
+        size_t i;
+
+        switch (p) {
+                case SEQ:
+                        for (i = 0; i < n; ++i)
+                                idx[i] = i % nk;
+                        break;
+                case RAND:
+                        for (i = 0; i < n; ++i)
+                                idx[i] = rnd() % nk;
+                        break;
+                case ZIPF:
+                        zipf(idx, n, nk);
+                        break;
+                default:
+                        errx(5, "unknown pattern %d", p);
+        }
+}
+
+/* report prints a line of results.  The allocations are the ones made since
+ * the given counts. */
+static void
+report(const char *op, const char *pattern, size_t nk, long long ns,
+                size_t nops, size_t sallocs, size_t stallocs)
+{
+        double nalloc;
+
+        nalloc = (allocs - sallocs) + (tstats.allocs - stallocs);
+        printf("%-6s %-7s %6zu %9zu %10.1f %9.2f %9.1f\n", op, pattern, klen,
+                        nk, (double)ns / nops, nalloc / nops,
+                        0 == tstats.nkeys ? 0.0 :
+                        (double)tstats.bytes / tstats.nkeys);
+        fflush(stdout);
+}
+
+/* bench runs the benchmarks for a store of nk keys of length klen, using ops
+ * operations per benchmark. */
+static void
+bench(size_t nk, size_t ops)
+{
+        size_t *idx, *order, *gone;
+        size_t i, j, n, ngone, sa, sta, dta, vlen;
+        long long start, ns;
+        enum pattern p;
+
+        /* Make the keys and room for the indices. */
+        if (NULL == (keys = calloc(nk, klen + 1)))
+                err(6, "calloc");
+        for (i = 0; i < nk; ++i)
+                snprintf(key(i), klen + 1, "%0*zu", (int)klen, i);
+        if (NULL == (order = calloc(nk, sizeof(*order))) ||
+                        NULL == (idx = calloc(ops, sizeof(*idx))) ||
+                        NULL == (gone = calloc(BATCH, sizeof(*gone))))
+                err(7, "calloc");
+
+        /* Fill the store in order, then empty it and fill it randomly. */
+        for (p = SEQ; p <= RAND; ++p) {
+                for (i = 0; i < nk; ++i)
+                        order[i] = i;
+                for (i = nk - 1; RAND == p && 0 < i; --i) {
+                        j = rnd() % (i + 1);
+                        n = order[i]; order[i] = order[j]; order[j] = n;
+                }
+                if (SEQ != p)
+                        for (i = 0; i < nk; ++i)
+                                tree_del(key(i), klen);
+                sa = allocs; sta = tstats.allocs;
+                start = now();
+                for (i = 0; i < nk; ++i)
+                        put(order[i]);
+                report("insert", pnames[p], nk, now() - start, nk, sa, sta);
+        }
+
+        /* Lookups, updates, and deletes in each pattern. */
+        for (p = SEQ; p < NPATTERNS; ++p) {
+                indices(idx, ops, nk, p);
+
+                sa = allocs; sta = tstats.allocs;
+                start = now();
+                for (i = 0; i < ops; ++i)
+                        if (NULL != tree_get(key(idx[i]), klen, &vlen))
+                                sink += vlen;
+                report("get", pnames[p], nk, now() - start, ops, sa, sta);
+
+                sa = allocs; sta = tstats.allocs;
+                start = now();
+                for (i = 0; i < ops; ++i)
+                        put(idx[i]);
+                report("set", pnames[p], nk, now() - start, ops, sa, sta);
+
+                /* Time deletes in batches, putting the keys back between.
+                 * Putting them back doesn't count, in time or allocations. */
+                for (ns = 0, dta = 0, i = 0; i < ops; i += n) {
+                        n = BATCH < ops - i ? BATCH : ops - i;
+                        ngone = 0;
+                        sta = tstats.allocs;
+                        start = now();
+                        for (j = i; j < i + n; ++j)
+                                if (0 == tree_del(key(idx[j]), klen))
+                                        gone[ngone++] = idx[j];
+                        ns += now() - start;
+                        dta += tstats.allocs - sta;
+                        for (j = 0; j < ngone; ++j)
+                                put(gone[j]);
+                }
+                /* Deletes don't allocate values, so only the tree's
+                 * allocations during the timed batches are left. */
+                report("del", pnames[p], nk, ns, ops, allocs,
+                                tstats.allocs - dta);
+        }
+
+        /* Walk the whole store, enough times for about ops keys. */
+        n = 0;
+        sa = allocs; sta = tstats.allocs;
+        start = now();
+        for (i = 0; i == 0 || i < ops / nk; ++i)
+                tree_walk(count, &n);
+        report("list", "-", nk, now() - start, n, sa, sta);
+
+        /* Empty the store for next time. */
+        for (i = 0; i < nk; ++i)
+                tree_del(key(i), klen);
+        FREE(gone);
+        FREE(idx);
+        FREE(order);
+        FREE(keys);
+}
+
+int
+main(int argc, char **argv)
+{
+        size_t ki, ni, onlyk, onlyn, ops, maxmem;
+        const char *errstr;
+        int ch;
+
+        onlyk = onlyn = 0;
+        ops = DEF_OPS;
+        maxmem = DEF_MAXMEM;
+        while ((ch = getopt(argc, argv, "k:m:n:o:h")) != -1) {
+                switch (ch) {
+                        case 'k':
+                                onlyk = strtonum(optarg, 8, 1024, &errstr);
+                                if (NULL != errstr)
+                                        errx(8, "key length %s", errstr);
+                                break;
+                        case 'm':
+                                maxmem = strtonum(optarg, 1, SIZE_MAX >> 20,
+                                                &errstr);
+                                if (NULL != errstr)
+                                        errx(9, "maxmem %s", errstr);
+                                break;
+                        case 'n':
+                                onlyn = strtonum(optarg, 1, 100000000,
+                                                &errstr);
+                                if (NULL != errstr)
+                                        errx(10, "nkeys %s", errstr);
+                                break;
+                        case 'o':
+                                ops = strtonum(optarg, 1, 1000000000, &errstr);
+                                if (NULL != errstr)
+                                        errx(11, "ops %s", errstr);
+                                break;
+                        case 'h':
+                        default:
+                                usage();
+                }
+        }
+        if (0 != onlyk)
+                klens[0] = onlyk;
+        if (0 != onlyn)
+                nkeys[0] = onlyn;
+
+        if (-1 == pledge("stdio", ""))
+                err(12, "pledge");
+
+        printf("%-6s %-7s %6s %9s %10s %9s %9s\n", "op", "pattern", "keylen",
+                        "nkeys", "ns/op", "allocs/op", "bytes/key");
+        for (ki = 0; ki < (0 != onlyk ? 1 :
+                                        sizeof(klens)/sizeof(klens[0])); ++ki) {
+                klen = klens[ki];
+                for (ni = 0; ni < (0 != onlyn ? 1 :
+                                                sizeof(nkeys)/sizeof(nkeys[0])); ++ni) {
+                        /* Our keys and fill order, plus the tree's copies,
+                         * values, and nodes, roughly. */
+                        if (maxmem < (nkeys[ni] * (2 * (klen + 1) +
+                                                        sizeof(size_t) +
+                                                        STRHDR + VALLEN + 1 +
+                                                        64)) >> 20) {
+                                printf("# skipping keylen %zu, nkeys %zu: "
+                                                "more than %zuMB\n", klen,
+                                                nkeys[ni], maxmem);
+                                continue;
+                        }
+                        rstate = 0x9E3779B97F4A7C15ULL;
+                        bench(nkeys[ni], ops);
+                }
+        }
+
+        return 0;
+}
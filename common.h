@@ -3,7 +3,7 @@
  * Functions common to both server and client
  * By J. Stuart McMurray
  * Created 20230402
- * Last Modified 20230407
+ * Last Modified 20261019
  */
 
 #ifndef HAVE_COMMON_H
@@ -11,11 +11,16 @@
 
 #include <sys/un.h>
 
+#include <stdint.h>
 #include <stdlib.h>
 
 /* MAXBUF is the maximum buffer size we can send or receive on the socket. */
 #define MAXBUF 0xFFFF
 
+/* STRHDR is the size of the length which precedes a string on the wire.  In
+ * memory, a wire string is the length, the string itself, and a NUL. */
+#define STRHDR sizeof(uint16_t)
+
 /* SOCKNAME is the default name for the socket, inside the user's home
  * directory .*/
 #define SOCKNAME ".memkvd.sock"
@@ -25,6 +30,9 @@
 #define OP_SET 's'
 #define OP_DEL 'd'
 #define OP_ALL 'l'
+#define OP_TOP 't'
+#define OP_WATCH 'w'
+#define OP_WATCHV 'W'
 
 /* FREE frees x if it's not NULL. */
 #define FREE(x) do { if (NULL != (x)) {free((x)); (x) = NULL;} } while (0)
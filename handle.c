@@ -3,58 +3,446 @@
  * Handle memkv clients.
  * By J. Stuart McMurray
  * Created 20230402
- * Last Modified 20230402
+ * Last Modified 20261019
  */
 
 #include <sys/socket.h>
 
 #include <err.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "common.h"
+#include "handle.h"
+#include "reply.h"
+#include "trace.h"
 #include "tree.h"
+#include "watch.h"
 
-/* handle handles a connection from a client. */
-void
-handle(int c)
+/* Messages sent to clients we're about to drop. */
+#define BUSYMSG    "__Busy, try again later__\n"
+#define TIMEOUTMSG "__Request timed out__\n"
+
+/* client holds a client's partially-read request, or its reply. */
+struct client {
+        int        fd;       /* Client socket, -1 if the slot is free. */
+        long long  deadline; /* When the request or reply must be done. */
+        char       op;       /* Requested operation. */
+        int        haveop;   /* Nonzero once op has been read. */
+        int        nstr;     /* Number of strings op needs. */
+        int        cur;      /* Index of the string being read. */
+        char       lbuf[2];  /* Current string's length. */
+        size_t     loff;     /* Bytes of lbuf read so far. */
+        char      *strs[2];  /* Key and value, as wire strings. */
+        uint16_t   slens[2]; /* Lengths of strs, less STRHDR. */
+        size_t     soff;     /* Bytes of strs[cur] read so far. */
+        int        replying; /* Nonzero once the request's been handled. */
+        struct reply rep;    /* What's left to send back. */
+        int        more;     /* Nonzero if a listing has more to add. */
+        char      *last;     /* Last key listed, to resume from. */
+};
+
+static struct client clients[MAXCLIENTS];
+static struct pollfd pfds[1 + MAXCLIENTS + MAXWATCHERS]; /* Listener first. */
+static int           nclients;             /* Slots in use. */
+static size_t        buffered;             /* Bytes allocated for strs. */
+static long long     accept_after;         /* Don't accept before this. */
+
+/* monotime returns the monotonic clock, in milliseconds.  It terminates the
+ * program on error. */
+static long long
+monotime(void)
 {
-        char *key;
-        ssize_t klen;
-        char op;
+        struct timespec ts;
+
+        if (-1 == clock_gettime(CLOCK_MONOTONIC, &ts))
+                err(32, "clock_gettime");
+        return (long long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* say sends msg to c without blocking.  It's meant for short notes to clients
+ * we're about to drop, so errors are ignored. */
+static void
+say(int c, const char *msg)
+{
+        send(c, msg, strlen(msg), MSG_DONTWAIT);
+}
+
+/* free_strs zeros and frees cl's key and value. */
+static void
+free_strs(struct client *cl)
+{
+        int i;
+
+        for (i = 0; i < 2; ++i) {
+                if (NULL == cl->strs[i])
+                        continue;
+                explicit_bzero(cl->strs[i], STRHDR + cl->slens[i]);
+                FREE(cl->strs[i]);
+                buffered -= STRHDR + cl->slens[i] + 1;
+        }
+}
+
+/* free_client frees cl's slot, without closing its socket. */
+static void
+free_client(struct client *cl)
+{
+        free_strs(cl);
+        reply_free(&cl->rep);
+        FREE(cl->last);
+        explicit_bzero(cl, sizeof(*cl));
+        cl->fd = -1;
+        --nclients;
+}
+
+/* drop_client closes cl's socket and frees its slot. */
+static void
+drop_client(struct client *cl)
+{
+        TRACE(close, cl->op, cl->slens[0], cl->slens[1]);
+        close(cl->fd);
+        free_client(cl);
+}
 
-        key = NULL;
+/* next_region works out where the next bytes of cl's request go and how many
+ * of them we want, allocating memory for strings as needed.  It returns 1 if
+ * the request is complete, 0 if there's more to read, or -1 if the client
+ * should be dropped. */
+static int
+next_region(struct client *cl, char **p, size_t *n)
+{
+        uint16_t len;
+
+        /* First comes the op. */
+        if (!cl->haveop) {
+                *p = &cl->op;
+                *n = 1;
+                return 0;
+        }
 
-        /* Get the operation. */
-        if (-1 == recv(c, &op, 1, MSG_WAITALL)) {
-                warn("recv (op)");
-                goto out;
+        for (; cl->cur < cl->nstr; ++cl->cur, cl->loff = cl->soff = 0) {
+                /* Still reading the length. */
+                if (sizeof(cl->lbuf) > cl->loff) {
+                        *p = cl->lbuf + cl->loff;
+                        *n = sizeof(cl->lbuf) - cl->loff;
+                        return 0;
+                }
+                /* Got the length, make room for the string if we can.  We
+                 * keep the length in front, so values are stored ready to
+                 * send. */
+                if (NULL == cl->strs[cl->cur]) {
+                        memcpy(&len, cl->lbuf, sizeof(len));
+                        if (MAXBUFFERED - buffered < STRHDR + len + 1) {
+                                warnx("too much buffered, dropping client");
+                                say(cl->fd, BUSYMSG);
+                                return -1;
+                        }
+                        if (NULL == (cl->strs[cl->cur] =
+                                                calloc(STRHDR + len + 1, 1))) {
+                                warn("calloc");
+                                say(cl->fd, BUSYMSG);
+                                return -1;
+                        }
+                        memcpy(cl->strs[cl->cur], cl->lbuf, STRHDR);
+                        cl->slens[cl->cur] = len;
+                        buffered += STRHDR + len + 1;
+                }
+                /* Still reading the string. */
+                if (cl->slens[cl->cur] > cl->soff) {
+                        *p = cl->strs[cl->cur] + STRHDR + cl->soff;
+                        *n = cl->slens[cl->cur] - cl->soff;
+                        return 0;
+                }
         }
 
-        /* Unless we're listing, we'll need a key. */
-        if (OP_ALL != op) {
-                switch (klen = read_buf(c, &key)) {
+        return 1;
+}
+
+/* advance notes that nr more bytes of cl's request have been read into the
+ * region last returned by next_region. */
+static void
+advance(struct client *cl, size_t nr)
+{
+        /* If we just got the op, work out how many strings follow. */
+        if (!cl->haveop) {
+                cl->haveop = 1;
+                switch (cl->op) {
+                        case OP_GET:
+                        case OP_DEL:
+                        case OP_WATCH:
+                        case OP_WATCHV: cl->nstr = 1; break;
+                        case OP_SET: cl->nstr = 2; break;
+                        default:     cl->nstr = 0; break;
+                }
+                return;
+        }
+
+        if (sizeof(cl->lbuf) > cl->loff)
+                cl->loff += nr;
+        else
+                cl->soff += nr;
+}
+
+/* read_client reads as much of cl's request as is available, up to CHUNKLEN
+ * bytes so one client can't starve the others.  It returns 1 if the request
+ * is complete, 0 if there's more to read, or -1 if the client should be
+ * dropped. */
+static int
+read_client(struct client *cl)
+{
+        char *p;
+        size_t n, total;
+        ssize_t nr;
+        int ret;
+
+        for (total = 0; total < CHUNKLEN; total += nr) {
+                /* Work out where the next bytes go. */
+                if (0 != (ret = next_region(cl, &p, &n)))
+                        return ret;
+                if (CHUNKLEN - total < n)
+                        n = CHUNKLEN - total;
+
+                /* Get as much as we can without blocking. */
+                switch (nr = recv(cl->fd, p, n, MSG_DONTWAIT)) {
                         case -1: /* Error */
-                                warn("recv (key)");
-                                goto out;
+                                if (EAGAIN == errno || EINTR == errno)
+                                        return 0;
+                                warn("recv (request)");
+                                return -1;
                         case 0: /* EOF */
-                                warnx("eof (key)");
-                                goto out;
+                                warnx("eof (request)");
+                                return -1;
                 }
+                advance(cl, nr);
         }
 
-        /* Work out what to do. */
-        switch (op) {
-                case OP_GET: get(c, key); break;
-                case OP_SET: set(c, key); break;
-                case OP_DEL: del(c, key); break;
-                case OP_ALL: all(c);      break;
+        return next_region(cl, &p, &n);
+}
+
+/* refill adds the next chunk of cl's listing to its reply.  It returns 1 if
+ * there's more to come, 0 if not, or -1 on error. */
+static int
+refill(struct client *cl)
+{
+        if (OP_TOP == cl->op)
+                return stats(&cl->rep, &cl->last);
+        return all(&cl->rep, &cl->last);
+}
+
+/* send_reply sends as much of cl's reply as it can without blocking, and
+ * drops cl once it's all sent.  Listings are added a chunk at a time, once
+ * the previous chunk's been sent, at most one chunk per call so others get a
+ * turn.  Each chunk gets WRITE_TIMEOUT to be read. */
+static void
+send_reply(struct client *cl)
+{
+        int ret;
+
+        ret = reply_flush(&cl->rep);
+        if (0 == ret && cl->more) {
+                if (-1 == (cl->more = refill(cl))) {
+                        warn("listing");
+                        drop_client(cl);
+                        return;
+                }
+                cl->deadline = monotime() + WRITE_TIMEOUT;
+                ret = reply_flush(&cl->rep);
+        }
+
+        switch (ret) {
+                case -1: /* Error */
+                        warn("send (reply)");
+                        drop_client(cl);
+                        break;
+                case 0: /* All sent */
+                        if (cl->more)
+                                break;
+                        TRACE(reply, cl->op, cl->slens[0], cl->slens[1]);
+                        drop_client(cl);
+                        break;
+        }
+}
+
+/* dispatch performs cl's complete request and starts sending the reply,
+ * unless cl's now a watcher. */
+static void
+dispatch(struct client *cl)
+{
+        struct reply *r;
+        char *key;
+
+        key = NULL == cl->strs[0] ? NULL : cl->strs[0] + STRHDR;
+        r = &cl->rep;
+        r->fd = cl->fd;
+        TRACE(op, cl->op, cl->slens[0], cl->slens[1]);
+        switch (cl->op) {
+                case OP_GET: get(r, key, cl->slens[0]); break;
+                case OP_SET:
+                        /* set takes ownership of the value. */
+                        buffered -= STRHDR + cl->slens[1] + 1;
+                        set(r, key, cl->slens[0], cl->strs[1],
+                                        cl->slens[1]);
+                        cl->strs[1] = NULL;
+                        break;
+                case OP_DEL: del(r, key, cl->slens[0]); break;
+                case OP_ALL:
+                case OP_TOP:
+                        /* Listed a chunk at a time, by send_reply. */
+                        cl->more = 1;
+                        break;
+                case OP_WATCH:
+                case OP_WATCHV:
+                        /* Watchers stick around, in watch.c. */
+                        if (-1 == watch_add(cl->fd, key, cl->slens[0],
+                                                OP_WATCHV == cl->op,
+                                                tree_version())) {
+                                reply_printf(r, BUSYMSG);
+                                break;
+                        }
+                        free_client(cl);
+                        return;
                 default:
-                        dprintf(c, "Unknown operation %c.\n", op);
+                        reply_printf(r, "Unknown operation %c.\n", cl->op);
                         break;
         }
 
-out:
-        FREE(key);
-        close(c);
+        /* The client gets WRITE_TIMEOUT to read its reply. */
+        free_strs(cl);
+        cl->replying = 1;
+        cl->deadline = monotime() + WRITE_TIMEOUT;
+        send_reply(cl);
+}
+
+/* accept_client accepts a new client on lfd, if we have room for it.  It
+ * returns -1 on unrecoverable error. */
+static int
+accept_client(int lfd)
+{
+        struct sockaddr_un sa;
+        socklen_t len;
+        int c, i;
+
+        /* Clients never get to block us. */
+        len = sizeof(sa);
+        if (-1 == (c = accept4(lfd, (struct sockaddr *)&sa, &len,
+                                        SOCK_NONBLOCK))) {
+                switch (errno) {
+                        case EMFILE:
+                        case ENFILE:
+                                /* Keep serving who we have for a bit. */
+                                accept_after = monotime() + ACCEPT_BACKOFF;
+                                return 0;
+                        case ECONNABORTED:
+                        case EINTR:
+                        case EAGAIN:
+                                return 0;
+                        default:
+                                return -1;
+                }
+        }
+
+        /* No room at the inn. */
+        if (MAXCLIENTS == nclients) {
+                say(c, BUSYMSG);
+                close(c);
+                return 0;
+        }
+
+        /* There's at least one free slot. */
+        for (i = 0; -1 != clients[i].fd; ++i)
+                ;
+        clients[i].fd = c;
+        clients[i].deadline = monotime() + READ_TIMEOUT;
+        ++nclients;
+        TRACE(accept, 0, 0, 0);
+
+        return 0;
+}
+
+/* serve accepts clients on lfd and handles their requests.  It only returns
+ * on error, with errno set. */
+void
+serve(int lfd)
+{
+        struct client *cl;
+        long long now, next;
+        int i, timeout;
+
+        for (i = 0; i < MAXCLIENTS; ++i)
+                clients[i].fd = -1;
+
+        for (;;) {
+                /* Work out who we're waiting on and for how long. */
+                now = monotime();
+                next = LLONG_MAX;
+                pfds[0].fd = lfd;
+                pfds[0].events = POLLIN;
+                if (now < accept_after) {
+                        pfds[0].fd = -1;
+                        next = accept_after;
+                }
+                for (i = 0; i < MAXCLIENTS; ++i) {
+                        cl = &clients[i];
+                        pfds[i + 1].fd = cl->fd;
+                        pfds[i + 1].events = cl->replying ? POLLOUT : POLLIN;
+                        if (-1 != cl->fd && cl->deadline < next)
+                                next = cl->deadline;
+                }
+                watch_pollfds(pfds + 1 + MAXCLIENTS);
+                if (LLONG_MAX == next)
+                        timeout = INFTIM;
+                else if (next <= now)
+                        timeout = 0;
+                else if (INT_MAX < next - now)
+                        timeout = INT_MAX;
+                else
+                        timeout = next - now;
+
+                if (-1 == poll(pfds, sizeof(pfds)/sizeof(pfds[0]), timeout)) {
+                        if (EINTR == errno)
+                                continue;
+                        return;
+                }
+
+                /* Give everybody with something to say a turn, and get rid
+                 * of anybody who's taking too long. */
+                now = monotime();
+                for (i = 0; i < MAXCLIENTS; ++i) {
+                        cl = &clients[i];
+                        if (-1 == cl->fd)
+                                continue;
+                        if (0 != pfds[i + 1].revents && cl->replying) {
+                                send_reply(cl);
+                                if (-1 == cl->fd)
+                                        continue;
+                        } else if (0 != pfds[i + 1].revents) {
+                                switch (read_client(cl)) {
+                                        case -1: drop_client(cl); continue;
+                                        case 1:  dispatch(cl);    continue;
+                                }
+                        }
+                        if (cl->deadline <= now && cl->replying) {
+                                warnx("reply timed out");
+                                drop_client(cl);
+                        } else if (cl->deadline <= now) {
+                                warnx("request timed out");
+                                say(cl->fd, TIMEOUTMSG);
+                                drop_client(cl);
+                        }
+                }
+
+                /* Keep watchers up to date. */
+                watch_service(pfds + 1 + MAXCLIENTS);
+
+                /* Let in at most one new client per round. */
+                if (0 != (pfds[0].revents & POLLIN) &&
+                                -1 == accept_client(lfd))
+                        return;
+        }
 }
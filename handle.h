@@ -3,13 +3,38 @@
  * Handle memkv clients.
  * By J. Stuart McMurray
  * Created 20230402
- * Last Modified 20230402
+ * Last Modified 20261019
  */
 
 #ifndef HAVE_HANDLE_H
 #define HAVE_HANDLE_H
 
-/* handle handles a connection from a client. */
-void handle(int c);
+/* MAXCLIENTS is the maximum number of clients we'll serve at once.  Clients
+ * past this are told we're busy and disconnected. */
+#define MAXCLIENTS 64
+
+/* MAXBUFFERED is the most memory, in bytes, we'll allocate for requests which
+ * haven't been completely read, summed over all clients. */
+#define MAXBUFFERED (4 * 1024 * 1024)
+
+/* CHUNKLEN is the most we'll read from one client before giving the others a
+ * turn. */
+#define CHUNKLEN 4096
+
+/* READ_TIMEOUT is how long, in milliseconds, a client has to send its entire
+ * request. */
+#define READ_TIMEOUT 5000
+
+/* WRITE_TIMEOUT is how long, in milliseconds, a client has to read its entire
+ * reply, or each chunk of a long listing. */
+#define WRITE_TIMEOUT 5000
+
+/* ACCEPT_BACKOFF is how long, in milliseconds, we stop accepting clients after
+ * running out of file descriptors. */
+#define ACCEPT_BACKOFF 100
+
+/* serve accepts clients on lfd and handles their requests.  It only returns
+ * on error, with errno set. */
+void serve(int lfd);
 
 #endif /* #ifdef HAVE_HANDLE_H */
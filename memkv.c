@@ -3,7 +3,7 @@
  * In-memory Key-Value store
  * By J. Stuart McMurray
  * Created 20230401
- * Last Modified 20230403
+ * Last Modified 20261019
  */
 
 #include <sys/socket.h>
@@ -23,7 +23,7 @@
 void
 usage(void)
 {
-        fprintf(stderr, "Usage: %s [-h] [-S path] {-gsdl} [key [value]]\n"
+        fprintf(stderr, "Usage: %s [-h] [-S path] {-gsdltwW} [key [value]]\n"
 "\n"
 "Gets, sets, deletes, or lists key/values pairs stored in memkvd.\n"
 "\n"
@@ -33,7 +33,10 @@ usage(void)
 "  -g      - Get a key's value\n"
 "  -s      - Set a key's value\n"
 "  -d      - Delete a key/value pair\n"
-"  -l      - List all keys\n",
+"  -l      - List all keys\n"
+"  -t      - List hot keys and per-key access stats\n"
+"  -w      - Watch for changes to keys starting with key\n"
+"  -W      - Like -w, but also show new values\n",
                         getprogname(), default_socket);
         exit(1);
 }
@@ -100,13 +103,16 @@ main(int argc, char **argv)
         /* Work out what we're meant to do. */
         op = 0;
         addr = NULL;
-        while ((ch = getopt(argc, argv, "S:gsdlh")) != -1) {
+        while ((ch = getopt(argc, argv, "S:gsdltwWh")) != -1) {
                 switch (ch) {
                         case 'S': addr = optarg; break;
                         case OP_GET: /* Get */
                         case OP_SET: /* Set */
                         case OP_DEL: /* Delete */
                         case OP_ALL: /* List */
+                        case OP_TOP: /* Stats */
+                        case OP_WATCH: /* Watch */
+                        case OP_WATCHV: /* Watch, with values */
                                 if (0 != op)
                                         errx(9, "cannot use %c and %c together",
                                                         op, ch);
@@ -120,11 +126,11 @@ main(int argc, char **argv)
         argc -= optind;
         argv += optind;
         if (0 == op)
-                errx(11, "Need one of -g, -s, or -d");
+                errx(11, "Need one of -g, -s, -d, -l, -t, -w, or -W");
 
         /* Get the key and maybe the value. */
         key = value = NULL;
-        if (OP_ALL != op) {
+        if (OP_ALL != op && OP_TOP != op) {
                 if (0 == argc)
                         errx(18, "need a key");
                 key = argv[0];
@@ -156,7 +162,8 @@ main(int argc, char **argv)
                 err(24, "send(key)");
         if (NULL != value && -1 == send_buf(s, value, strlen(value)))
                 err(25, "send(value)");
-        if (-1 == shutdown(s, SHUT_WR))
+        /* Watchers keep the connection open; closing it stops watching. */
+        if (OP_WATCH != op && OP_WATCHV != op && -1 == shutdown(s, SHUT_WR))
                 err(26, "shutdown");
 
 
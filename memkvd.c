@@ -3,13 +3,14 @@
  * Server side of memkvs
  * By J. Stuart McMurray
  * Created 20230402
- * Last Modified 20230407
+ * Last Modified 20261019
  */
 
 #include <sys/socket.h>
 
 #include <err.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -62,9 +63,8 @@ sighandler(int sig)
 int
 main(int argc, char **argv)
 {
-        int dflag, rflag, ch, c, i;
+        int dflag, rflag, ch, i;
         struct sockaddr_un sa;
-        socklen_t len;
 
 
         if (-1 == pledge("cpath getpw proc stdio unix unveil", ""))
@@ -124,6 +124,10 @@ main(int argc, char **argv)
                 err(6, "bind");
         if (-1 == listen(lfd, 128))
                 err(7, "listen");
+        /* A client which goes away between poll and accept mustn't leave
+         * us waiting for the next one. */
+        if (-1 == fcntl(lfd, F_SETFL, fcntl(lfd, F_GETFL) | O_NONBLOCK))
+                err(34, "fcntl");
 
         if (-1 == pledge("cpath proc stdio unix", ""))
                 err(30, "pledge");
@@ -133,6 +137,9 @@ main(int argc, char **argv)
                 if (SIG_ERR == signal(to_catch[i], sighandler))
                         err(13, "signal (%d)", i);
         }
+        /* Clients which hang up early shouldn't kill us. */
+        if (SIG_ERR == signal(SIGPIPE, SIG_IGN))
+                err(33, "signal (SIGPIPE)");
 
         /* Background ourselves, if we're meant to. */
         if (!dflag)
@@ -147,22 +154,7 @@ main(int argc, char **argv)
         printf("Ready\n");
 
         /* Accept clients and handle requests. */
-        for (;;) {
-                /* Pop a client and handle if all went well. */
-                len = sizeof(sa);
-                if (-1 != (c = accept(lfd, (struct sockaddr *)&sa, &len))) {
-                        handle(c);
-                        continue;
-                }
-                /* EMFILE and ENFILE are handleable. */
-                switch (errno) {
-                        case EMFILE:
-                        case ENFILE:
-                                sleep(1);
-                                continue;
-                        default:
-                                unlink_sock();
-                                err(9, "accept");
-                }
-        }
+        serve(lfd);
+        unlink_sock();
+        err(9, "serve");
 }
@@ -0,0 +1,146 @@
+/*
+ * reply.c
+ * Buffer replies to clients.
+ * By J. Stuart McMurray
+ * Created 20261019
+ * Last Modified 20261019
+ */
+
+#include <sys/socket.h>
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "reply.h"
+
+/* MINREPLY is the smallest buffer we'll allocate. */
+#define MINREPLY 1024
+
+/* grow makes r's buffer at least need bytes long.  It returns -1 on error. */
+static int
+grow(struct reply *r, size_t need)
+{
+        size_t ncap;
+        char *nbuf;
+
+        if (r->cap >= need)
+                return 0;
+        for (ncap = 0 == r->cap ? MINREPLY : r->cap; ncap < need; ncap *= 2)
+                ;
+
+        /* recallocarray zeros the old buffer, which may hold values. */
+        if (NULL == (nbuf = recallocarray(r->buf, r->cap, ncap, 1)))
+                return -1;
+        r->buf = nbuf;
+        r->cap = ncap;
+
+        return 0;
+}
+
+/* room makes sure there's room for n more bytes in r's buffer.  It returns
+ * -1 on error. */
+static int
+room(struct reply *r, size_t n)
+{
+        /* Move what's left to the front, if we've sent some. */
+        if (r->cap - r->len < n && 0 != r->off) {
+                memmove(r->buf, r->buf + r->off, r->len - r->off);
+                r->len -= r->off;
+                explicit_bzero(r->buf + r->len, r->off);
+                r->off = 0;
+        }
+
+        return grow(r, r->len + n);
+}
+
+/* reply_write adds n bytes from p to the reply.  If nothing's waiting to be
+ * sent, as much as possible is sent straight from p.  It returns -1 on error,
+ * with errno set. */
+int
+reply_write(struct reply *r, const void *p, size_t n)
+{
+        ssize_t nw;
+
+        /* Skip the copy if we can. */
+        if (r->off == r->len) {
+                if (-1 == (nw = send(r->fd, p, n, MSG_DONTWAIT)))
+                        nw = 0;
+                p = (const char *)p + nw;
+                n -= nw;
+        }
+        if (0 == n)
+                return 0;
+
+        if (-1 == room(r, n))
+                return -1;
+        memcpy(r->buf + r->len, p, n);
+        r->len += n;
+
+        return 0;
+}
+
+/* reply_printf adds a formatted string to the reply.  It returns -1 on
+ * error, with errno set. */
+int
+reply_printf(struct reply *r, const char *fmt, ...)
+{
+        va_list ap;
+        int n;
+
+        /* Work out how long it'll be, then put it right in the buffer. */
+        va_start(ap, fmt);
+        n = vsnprintf(NULL, 0, fmt, ap);
+        va_end(ap);
+        if (0 > n || -1 == room(r, n + 1))
+                return -1;
+        va_start(ap, fmt);
+        vsnprintf(r->buf + r->len, n + 1, fmt, ap);
+        va_end(ap);
+        r->len += n;
+
+        return 0;
+}
+
+/* reply_full returns nonzero if at least MAXREPLY bytes are waiting to be
+ * sent, i.e. it's time to stop adding to a long reply. */
+int
+reply_full(struct reply *r)
+{
+        return MAXREPLY <= r->len - r->off;
+}
+
+/* reply_flush sends as much of the reply as it can without blocking.  It
+ * returns 0 once the whole reply's been sent, 1 if there's more to send, or
+ * -1 on error. */
+int
+reply_flush(struct reply *r)
+{
+        ssize_t nw;
+
+        for (; r->off < r->len; r->off += nw) {
+                nw = send(r->fd, r->buf + r->off, r->len - r->off,
+                                MSG_DONTWAIT);
+                if (-1 == nw) {
+                        if (EAGAIN == errno || EINTR == errno)
+                                return 1;
+                        return -1;
+                }
+        }
+
+        return 0;
+}
+
+/* reply_free zeros and frees the reply's buffer. */
+void
+reply_free(struct reply *r)
+{
+        if (NULL != r->buf) {
+                explicit_bzero(r->buf, r->cap);
+                FREE(r->buf);
+        }
+        r->cap = r->off = r->len = 0;
+}
@@ -0,0 +1,50 @@
+/*
+ * reply.h
+ * Buffer replies to clients.
+ * By J. Stuart McMurray
+ * Created 20261019
+ * Last Modified 20261019
+ */
+
+#ifndef HAVE_REPLY_H
+#define HAVE_REPLY_H
+
+#include <stddef.h>
+
+/* MAXREPLY is about the most of a reply, in bytes, we'll buffer for one
+ * client.  Longer replies are added a chunk this big at a time, as the client
+ * reads them. */
+#define MAXREPLY (1024 * 1024)
+
+/* reply is a reply to a client, sent without blocking. */
+struct reply {
+        int     fd;        /* Client socket. */
+        char   *buf;       /* Unsent bytes, allocated as needed. */
+        size_t  cap;       /* Size of buf. */
+        size_t  off;       /* Start of unsent bytes in buf. */
+        size_t  len;       /* End of unsent bytes in buf. */
+};
+
+/* reply_write adds n bytes from p to the reply.  If nothing's waiting to be
+ * sent, as much as possible is sent straight from p.  It returns -1 on error,
+ * with errno set. */
+int reply_write(struct reply *r, const void *p, size_t n);
+
+/* reply_printf adds a formatted string to the reply.  It returns -1 on
+ * error, with errno set. */
+int reply_printf(struct reply *r, const char *fmt, ...)
+        __attribute__((__format__ (printf, 2, 3)));
+
+/* reply_full returns nonzero if at least MAXREPLY bytes are waiting to be
+ * sent, i.e. it's time to stop adding to a long reply. */
+int reply_full(struct reply *r);
+
+/* reply_flush sends as much of the reply as it can without blocking.  It
+ * returns 0 once the whole reply's been sent, 1 if there's more to send, or
+ * -1 on error. */
+int reply_flush(struct reply *r);
+
+/* reply_free zeros and frees the reply's buffer. */
+void reply_free(struct reply *r);
+
+#endif /* #ifndef HAVE_REPLY_H */
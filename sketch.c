@@ -0,0 +1,184 @@
+/*
+ * sketch.c
+ * Track hot keys with a count-min sketch.
+ * By J. Stuart McMurray
+ * Created 20261019
+ * Last Modified 20261019
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "sketch.h"
+
+/* hotkey is one of the heaviest hitters. */
+struct hotkey {
+        uint64_t  hash;  /* Hash of key. */
+        char     *key;   /* Key, NULL if the slot's unused. */
+        size_t    klen;  /* Length of key. */
+        size_t    kcap;  /* Size of key's buffer, reused when possible. */
+        uint32_t  count; /* Estimated accesses. */
+};
+
+static uint32_t      counts[SKETCH_DEPTH][SKETCH_WIDTH];
+static uint32_t      nadds;             /* Accesses since the last decay. */
+static struct hotkey top[SKETCH_TOPK];
+
+/* hash returns the 64-bit FNV-1a hash of key. */
+static uint64_t
+hash(const char *key, size_t klen)
+{
+        uint64_t h;
+        size_t i;
+
+        h = 0xCBF29CE484222325ULL;
+        for (i = 0; i < klen; ++i) {
+                h ^= (unsigned char)key[i];
+                h *= 0x100000001B3ULL;
+        }
+        return h;
+}
+
+/* counter returns the key's counter in row, for the key's hash h.  Rows use
+ * h's two halves combined differently, which is as good as independent
+ * hashes. */
+static uint32_t *
+counter(int row, uint64_t h)
+{
+        uint32_t h1, h2;
+
+        h1 = h;
+        h2 = (h >> 32) | 1;
+        return &counts[row][(h1 + row * h2) % SKETCH_WIDTH];
+}
+
+/* decay halves every count. */
+static void
+decay(void)
+{
+        int i, j;
+
+        for (i = 0; i < SKETCH_DEPTH; ++i)
+                for (j = 0; j < SKETCH_WIDTH; ++j)
+                        counts[i][j] >>= 1;
+        for (i = 0; i < SKETCH_TOPK; ++i)
+                top[i].count >>= 1;
+        nadds = 0;
+}
+
+/* estimate returns the smallest of the counters for the key with hash h. */
+static uint32_t
+estimate(uint64_t h)
+{
+        uint32_t est, *c;
+        int i;
+
+        est = UINT32_MAX;
+        for (i = 0; i < SKETCH_DEPTH; ++i)
+                if (*(c = counter(i, h)) < est)
+                        est = *c;
+        return est;
+}
+
+/* sketch_add counts an access to key, which is klen bytes long.  It returns
+ * the number of allocations it made. */
+int
+sketch_add(const char *key, size_t klen)
+{
+        struct hotkey *hk;
+        uint64_t h;
+        uint32_t est, *c;
+        char *kc;
+        int i, min, nalloc;
+
+        if (SKETCH_DECAY <= ++nadds)
+                decay();
+
+        /* Count it, and the smallest counter is our best guess. */
+        h = hash(key, klen);
+        est = UINT32_MAX;
+        for (i = 0; i < SKETCH_DEPTH; ++i) {
+                c = counter(i, h);
+                if (UINT32_MAX != *c)
+                        ++*c;
+                if (*c < est)
+                        est = *c;
+        }
+
+        /* If it's already a heavy hitter, just update the count. */
+        min = 0;
+        for (i = 0; i < SKETCH_TOPK; ++i) {
+                if (h == top[i].hash && NULL != top[i].key &&
+                                klen == top[i].klen &&
+                                0 == memcmp(top[i].key, key, klen)) {
+                        top[i].count = est;
+                        return 0;
+                }
+                if (top[i].count < top[min].count)
+                        min = i;
+        }
+
+        /* If not, it replaces the least-heavy hitter, if it's heavier.
+         * The stored count may be stale, so check the sketch, lest every
+         * new key look heavier. */
+        hk = &top[min];
+        if (NULL != hk->key)
+                hk->count = estimate(hk->hash);
+        if (est <= hk->count)
+                return 0;
+
+        /* Reuse the key buffer if it's big enough. */
+        nalloc = 0;
+        if (hk->kcap < klen + 1) {
+                if (NULL == (kc = malloc(klen + 1)))
+                        return 0; /* Only stats, not worth failing over. */
+                FREE(hk->key);
+                hk->key = kc;
+                hk->kcap = klen + 1;
+                ++nalloc;
+        }
+        memcpy(hk->key, key, klen);
+        hk->key[klen] = '\0';
+        hk->klen = klen;
+        hk->hash = h;
+        hk->count = est;
+
+        return nalloc;
+}
+
+/* sketch_count returns the estimated number of accesses to key, which is klen
+ * bytes long.  The estimate may be high, but is never low. */
+uint32_t
+sketch_count(const char *key, size_t klen)
+{
+        return estimate(hash(key, klen));
+}
+
+/* hotter compares hotkeys for qsort, hottest first. */
+static int
+hotter(const void *a, const void *b)
+{
+        uint32_t ca, cb;
+
+        ca = ((const struct hotkey *)a)->count;
+        cb = ((const struct hotkey *)b)->count;
+        return (ca < cb) - (ca > cb);
+}
+
+/* sketch_top calls f with each of the heaviest hitters and its estimated
+ * number of accesses, hottest first, until f returns nonzero. */
+void
+sketch_top(int (*f)(const char *key, uint32_t count, void *arg), void *arg)
+{
+        int i;
+
+        qsort(top, SKETCH_TOPK, sizeof(top[0]), hotter);
+        for (i = 0; i < SKETCH_TOPK; ++i) {
+                if (NULL == top[i].key)
+                        continue;
+                if (0 != f(top[i].key, top[i].count, arg))
+                        return;
+        }
+}
@@ -0,0 +1,39 @@
+/*
+ * sketch.h
+ * Track hot keys with a count-min sketch.
+ * By J. Stuart McMurray
+ * Created 20261019
+ * Last Modified 20261019
+ */
+
+#ifndef HAVE_SKETCH_H
+#define HAVE_SKETCH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* The sketch is SKETCH_DEPTH rows of SKETCH_WIDTH counters. */
+#define SKETCH_DEPTH 4
+#define SKETCH_WIDTH 4096
+
+/* SKETCH_TOPK is the number of heavy hitters we remember. */
+#define SKETCH_TOPK 16
+
+/* SKETCH_DECAY is how many accesses we count before halving all of the
+ * counts, so old hot keys cool off. */
+#define SKETCH_DECAY (1 << 20)
+
+/* sketch_add counts an access to key, which is klen bytes long.  It returns
+ * the number of allocations it made. */
+int sketch_add(const char *key, size_t klen);
+
+/* sketch_count returns the estimated number of accesses to key, which is klen
+ * bytes long.  The estimate may be high, but is never low. */
+uint32_t sketch_count(const char *key, size_t klen);
+
+/* sketch_top calls f with each of the heaviest hitters and its estimated
+ * number of accesses, hottest first, until f returns nonzero. */
+void sketch_top(int (*f)(const char *key, uint32_t count, void *arg),
+                void *arg);
+
+#endif /* #ifndef HAVE_SKETCH_H */
@@ -0,0 +1,33 @@
+/*
+ * trace.h
+ * Statically-defined tracepoints on the request path.
+ * By J. Stuart McMurray
+ * Created 20261019
+ * Last Modified 20261019
+ */
+
+#ifndef HAVE_TRACE_H
+#define HAVE_TRACE_H
+
+/* Use <sys/sdt.h> if we have it, unless asked not to. */
+#if !defined(NO_SDT) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define HAVE_SDT
+#endif /* #if __has_include(<sys/sdt.h>) */
+#endif /* #if !defined(NO_SDT) && defined(__has_include) */
+
+/* TRACE fires the memkvd:name tracepoint with the request's op and key and
+ * value lengths, for bpftrace, perf, and friends.  A tracepoint is a nop
+ * until something attaches to it.  Without <sys/sdt.h>, or with NO_SDT
+ * defined, tracepoints aren't compiled in at all. */
+#ifdef HAVE_SDT
+#define TRACE(name, op, klen, vlen) DTRACE_PROBE3(memkvd, name, \
+                (int)(op), (size_t)(klen), (size_t)(vlen))
+#else /* #ifdef HAVE_SDT */
+#define TRACE(name, op, klen, vlen) do { \
+        (void)(op); (void)(klen); (void)(vlen); \
+} while (0)
+#endif /* #ifdef HAVE_SDT */
+
+#endif /* #ifndef HAVE_TRACE_H */
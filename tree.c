@@ -3,7 +3,7 @@
  * Store k/v pairs in a tree.
  * By J. Stuart McMurray
  * Created 20230402
- * Last Modified 20230407
+ * Last Modified 20261019
  */
 
 /* Most of the below cribbed from OpenBSD's tree(3) manpage, under the
@@ -39,13 +39,32 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "common.h"
+#include "reply.h"
+#include "sketch.h"
+#include "trace.h"
+#include "tree.h"
+#include "watch.h"
+
+/* tstats describes the memory the tree is using. */
+struct tree_stats tstats;
+
+/* version is bumped every time a key is set or deleted. */
+static unsigned long long version;
+
+/* spare is a node ready for the next new key, so tree_set can try inserting
+ * before knowing whether the key's new. */
+static struct node *spare;
 
 struct node {
         RB_ENTRY(node) entry;
         char *key;
-        char *value;
+        size_t klen; /* Length of key, as allocated. */
+        char *value; /* Wire string, ready to send. */
+        size_t vlen; /* Length of value, less STRHDR. */
+        time_t atime; /* Last get or set, by monosec(). */
 };
 
 static int
@@ -58,111 +77,268 @@ RB_HEAD(kvtree, node) head = RB_INITIALIZER(&head);
 RB_PROTOTYPE(kvtree, node, entry, kvcmp)
 RB_GENERATE(kvtree, node, entry, kvcmp)
 
-/* all prints all of the keys to c. */
-void
-all(int c)
+/* monosec returns the monotonic clock, in seconds.  Unlike the wall clock, it
+ * doesn't jump when the time's set, so idle times stay sane.  It terminates
+ * the program on error. */
+static time_t
+monosec(void)
 {
-        struct node *n;
+        struct timespec ts;
 
-        RB_FOREACH(n, kvtree, &head) {
-                dprintf(c, "%s\n", n->key);
-        }
+        if (-1 == clock_gettime(CLOCK_MONOTONIC, &ts))
+                err(35, "clock_gettime");
+        return ts.tv_sec;
 }
 
-/* get prints the value for the key to c. */
-void
-get(int c, char *key)
+/* free_value zeros and frees value, a wire string vlen bytes long. */
+static void
+free_value(char *value, size_t vlen)
+{
+        explicit_bzero(value, STRHDR + vlen);
+        free(value);
+}
+
+/* tree_get returns key's value as a wire string and puts its length, less
+ * STRHDR, in *vlen, or returns NULL if key isn't in the tree. */
+const char *
+tree_get(char *key, size_t klen, size_t *vlen)
 {
         struct node kn, *fn;
 
-        /* Look for the key. */
         kn.key = key;
         fn = RB_FIND(kvtree, &head, &kn);
-        if (NULL == fn) {
-                dprintf(c, "__Key %s not found__\n", key);
-                return;
+        TRACE(lookup, OP_GET, klen, NULL == fn ? 0 : fn->vlen);
+        tstats.allocs += sketch_add(key, klen);
+        if (NULL == fn)
+                return NULL;
+        fn->atime = monosec();
+        *vlen = fn->vlen;
+        return fn->value;
+}
+
+/* tree_set adds or updates the key/value pair, taking ownership of value, a
+ * wire string whose length less STRHDR is vlen, even on error.  It returns 0
+ * if the key was added, 1 if it was updated, or -1 on error with errno set. */
+int
+tree_set(char *key, size_t klen, char *value, size_t vlen)
+{
+        struct node *fn;
+        char *kc;
+
+        tstats.allocs += sketch_add(key, klen);
+
+        /* Try to insert the key, walking the tree only once. */
+        if (NULL == spare) {
+                if (NULL == (spare = calloc(1, sizeof(*spare)))) {
+                        free_value(value, vlen);
+                        return -1;
+                }
+                ++tstats.allocs;
+        }
+        spare->key = key;
+
+        /* If we already have it, just swap the value. */
+        if (NULL != (fn = RB_INSERT(kvtree, &head, spare))) {
+                TRACE(insert, OP_SET, klen, vlen);
+                fn->atime = monosec();
+                tstats.bytes -= fn->vlen;
+                free_value(fn->value, fn->vlen);
+                fn->value = value;
+                fn->vlen = vlen;
+                tstats.bytes += vlen;
+                watch_notify(OP_SET, key, klen, value + STRHDR, vlen,
+                                ++version);
+                return 1;
+        }
+
+        /* It's new, and needs its own copy of the key. */
+        fn = spare;
+        if (NULL == (kc = calloc(klen + 1, 1))) {
+                RB_REMOVE(kvtree, &head, fn);
+                free_value(value, vlen);
+                return -1;
         }
-        dprintf(c, "%s", fn->value);
+        memcpy(kc, key, klen);
+        spare = NULL;
+        fn->key = kc;
+        fn->klen = klen;
+        fn->value = value;
+        fn->vlen = vlen;
+        fn->atime = monosec();
+        TRACE(insert, OP_SET, klen, vlen);
+        ++tstats.nkeys;
+        ++tstats.allocs;
+        tstats.bytes += sizeof(*fn) + klen + 1 + STRHDR + vlen + 1;
+        watch_notify(OP_SET, key, klen, value + STRHDR, vlen, ++version);
+
+        return 0;
 }
 
-/* set gets a value from c and sets the key/value pair. */
-void
-set(int c, char *key)
+/* tree_del removes key and its value from the tree.  It returns -1 if key
+ * wasn't in the tree. */
+int
+tree_del(char *key, size_t klen)
 {
-        char *nkey, *value;
-        ssize_t vlen;
-        struct node *old, *new;
+        struct node kn, *fn;
+
+        kn.key = key;
+        fn = RB_FIND(kvtree, &head, &kn);
+        TRACE(delete, OP_DEL, klen, NULL == fn ? 0 : fn->vlen);
+        tstats.allocs += sketch_add(key, klen);
+        if (NULL == fn)
+                return -1;
+        RB_REMOVE(kvtree, &head, fn);
+        --tstats.nkeys;
+        tstats.bytes -= sizeof(*fn) + fn->klen + 1 + STRHDR + fn->vlen + 1;
+        free_value(fn->value, fn->vlen);
+        FREE(fn->key);
+        FREE(fn);
+        watch_notify(OP_DEL, key, klen, NULL, 0, ++version);
 
-        nkey = value = NULL;
-        old = new = NULL;
+        return 0;
+}
 
-        /* Get the value. */
-        switch (vlen = read_buf(c, &value)) {
-                case -1: /* Error */
-                        warn("recv (value)");
-                        return;
-                case 0: /* EOF */
-                        warnx("eof (value)");
+/* tree_version returns the version of the most recent set or delete. */
+unsigned long long
+tree_version(void)
+{
+        return version;
+}
+
+/* tree_walk calls f with each key, in order, until f returns nonzero. */
+void
+tree_walk(int (*f)(const char *key, void *arg), void *arg)
+{
+        struct node *n;
+
+        RB_FOREACH(n, kvtree, &head) {
+                if (0 != f(n->key, arg))
                         return;
         }
+}
 
-        /* May need to save a copy of the key. */
-        if (-1 == asprintf(&nkey, "%s", key)) {
-                dprintf(c, "Copying key: %s\n", strerror(errno));
-                warn("asprintf");
-                goto out;
+/* list adds keys to r, one per line, with their stats if withstats is
+ * nonzero, until r is full.  It starts after *last, or at the first key if
+ * *last is NULL, and on return *last is a copy of the last key added, so the
+ * listing can be resumed once r's been sent, even if the tree's changed.  It
+ * returns 1 if there are more keys to list, 0 if not, or -1 on error. */
+static int
+list(struct reply *r, char **last, int withstats)
+{
+        struct node kn, *n;
+        time_t now;
+        int ret;
+
+        /* Pick up where we left off. */
+        if (NULL == *last)
+                n = RB_MIN(kvtree, &head);
+        else {
+                kn.key = *last;
+                n = RB_NFIND(kvtree, &head, &kn);
+                if (NULL != n && 0 == strcmp(n->key, *last))
+                        n = RB_NEXT(kvtree, &head, n);
+                FREE(*last);
         }
 
-        /* New pair to insert. */
-        if (NULL == (new = calloc(1, sizeof(struct node)))) {
-                dprintf(c, "Allocating memory: %s\n", strerror(errno));
-                warn("calloc");
-                goto out;
+        now = monosec();
+        for (; NULL != n; n = RB_NEXT(kvtree, &head, n)) {
+                if (withstats)
+                        ret = reply_printf(r, "%10lld %10u %5zu %s\n",
+                                        (long long)(now - n->atime),
+                                        sketch_count(n->key, n->klen),
+                                        n->vlen, n->key);
+                else
+                        ret = reply_printf(r, "%s\n", n->key);
+                if (-1 == ret)
+                        return -1;
+                if (reply_full(r))
+                        break;
         }
-        new->key = nkey;
-        new->value = value;
-
-        /* Try inserting. */
-        if (NULL == (old = RB_INSERT(kvtree, &head, new))) {
-                /* Insert success. */
-                dprintf(c, "Added %s\n", key);
-                printf("Added %s\n", key);
-                return;
-        } else {
-                /* Just an update. */
-                ZFREE(old->value);
-                old->value = value;
-                dprintf(c, "Updated %s\n", key);
-                printf("Updated %s\n", key);
-                value = NULL; /* Don't free it. */
+        if (NULL == n)
+                return 0;
+
+        /* Remember where we stopped. */
+        if (NULL == (*last = strdup(n->key)))
+                return -1;
+        return 1;
+}
+
+/* send_hot adds a heavy hitter and its estimated accesses to the reply r.  It
+ * stops the walk on error. */
+static int
+send_hot(const char *key, uint32_t count, void *r)
+{
+        return reply_printf(r, "%10u %s\n", count, key);
+}
+
+/* stats adds the hottest keys, and then how long it's been since each key was
+ * used, roughly how many times its been used, and how big its value is, to r.
+ * Like all, it adds a chunk at a time. */
+int
+stats(struct reply *r, char **last)
+{
+        /* The hot keys only go at the start. */
+        if (NULL == *last) {
+                if (-1 == reply_printf(r, "__Hot keys: accesses key__\n"))
+                        return -1;
+                sketch_top(send_hot, r);
+                if (-1 == reply_printf(r, "__All keys: idle-seconds accesses "
+                                        "value-bytes key__\n"))
+                        return -1;
         }
 
-out:
-        ZFREE(value);
-        FREE(nkey);
-        FREE(new);
+        return list(r, last, 1);
 }
 
-/* del deletes a key/value pair. */
+/* all adds the keys to r, about MAXREPLY bytes' worth at a time.  It starts
+ * after *last, or at the beginning if *last is NULL, and updates *last for
+ * next time.  It returns 1 if there's more to add once r's been sent, 0 if
+ * not, or -1 on error. */
+int
+all(struct reply *r, char **last)
+{
+        return list(r, last, 0);
+}
+
+/* get adds the value for the key to r. */
 void
-del(int c, char *key)
+get(struct reply *r, char *key, size_t klen)
 {
-        struct node kn, *fn;
+        const char *value;
+        size_t vlen;
 
-        /* Look for the key. */
-        kn.key = key;
-        fn = RB_FIND(kvtree, &head, &kn);
-        if (NULL == fn) {
-                dprintf(c, "__Key %s not found__\n", key);
+        if (NULL == (value = tree_get(key, klen, &vlen))) {
+                reply_printf(r, "__Key %s not found__\n", key);
                 return;
         }
-        if (fn != RB_REMOVE(kvtree, &head, fn)) {
-                dprintf(c, "__Removed something wrong?__\n");
+
+        /* The value's stored ready to go, so no formatting, and usually no
+         * copying.  Replies aren't framed, so skip the length. */
+        reply_write(r, value + STRHDR, vlen);
+}
+
+/* set sets the key/value pair.  It takes ownership of value. */
+void
+set(struct reply *r, char *key, size_t klen, char *value, size_t vlen)
+{
+        switch (tree_set(key, klen, value, vlen)) {
+                case -1:
+                        reply_printf(r, "Adding %s: %s\n", key,
+                                        strerror(errno));
+                        warn("tree_set");
+                        break;
+                case 0: reply_printf(r, "Added %s\n", key);   break;
+                case 1: reply_printf(r, "Updated %s\n", key); break;
+        }
+}
+
+/* del deletes a key/value pair. */
+void
+del(struct reply *r, char *key, size_t klen)
+{
+        if (-1 == tree_del(key, klen)) {
+                reply_printf(r, "__Key %s not found__\n", key);
                 return;
         }
-        FREE(fn->key);
-        ZFREE(fn->value);
-        FREE(fn);
-        dprintf(c, "Deleted %s\n", key);
-        printf("Deleted %s\n", key);
+        reply_printf(r, "Deleted %s\n", key);
 }
@@ -3,16 +3,55 @@
  * Store k/v pairs in a tree.
  * By J. Stuart McMurray
  * Created 20230402
- * Last Modified 20230402
+ * Last Modified 20261019
  */
 
 #ifndef HAVE_TREE_H
 #define HAVE_TREE_H
 
-void get(int c, char *key);
-void set(int c, char *key);
-void del(int c, char *key);
-void all(int c);
+#include <stddef.h>
+
+#include "reply.h"
+
+/* tree_stats describes the memory the tree is using. */
+struct tree_stats {
+        size_t nkeys;  /* Keys in the tree. */
+        size_t bytes;  /* Bytes held for nodes, keys, and values. */
+        size_t allocs; /* Allocations the tree's ever made. */
+};
+extern struct tree_stats tstats;
+
+/* tree_get returns key's value as a wire string and puts its length, less
+ * STRHDR, in *vlen, or returns NULL if key isn't in the tree. */
+const char *tree_get(char *key, size_t klen, size_t *vlen);
+
+/* tree_set adds or updates the key/value pair, taking ownership of value, a
+ * wire string whose length less STRHDR is vlen, even on error.  It returns 0
+ * if the key was added, 1 if it was updated, or -1 on error with errno set. */
+int tree_set(char *key, size_t klen, char *value, size_t vlen);
+
+/* tree_del removes key and its value from the tree.  It returns -1 if key
+ * wasn't in the tree. */
+int tree_del(char *key, size_t klen);
+
+/* tree_version returns the version of the most recent set or delete. */
+unsigned long long tree_version(void);
+
+/* tree_walk calls f with each key, in order, until f returns nonzero. */
+void tree_walk(int (*f)(const char *key, void *arg), void *arg);
+
+/* The below handle requests, adding what's to be sent back to r. */
+void get(struct reply *r, char *key, size_t klen);
+void set(struct reply *r, char *key, size_t klen, char *value, size_t vlen);
+void del(struct reply *r, char *key, size_t klen);
+
+/* all and stats list keys, which may take more than one reply's worth.  Each
+ * call adds about MAXREPLY bytes to r, starting after *last, or at the
+ * beginning if *last is NULL, and updates *last, which the caller must free.
+ * They return 1 if there's more to add once r's been sent, 0 if not, or -1 on
+ * error. */
+int all(struct reply *r, char **last);
+int stats(struct reply *r, char **last);
 
 #endif /* #ifdef HAVE_TREE_H */
 
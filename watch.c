@@ -0,0 +1,247 @@
+/*
+ * watch.c
+ * Tell watching clients about changed keys.
+ * By J. Stuart McMurray
+ * Created 20261019
+ * Last Modified 20261019
+ */
+
+#include <sys/socket.h>
+
+#include <err.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "trace.h"
+#include "watch.h"
+
+/* SLOWMSG is sent to watchers which fall too far behind. */
+#define SLOWMSG "__Too far behind, notifications lost__\n"
+
+/* watcher is a client watching for changes. */
+struct watcher {
+        int     fd;      /* Watcher's socket. */
+        char    op;      /* OP_WATCH or OP_WATCHV, for tracing. */
+        int     replied; /* Nonzero once the Watching line's been sent. */
+        char   *prefix;  /* Keys to watch, NULL if the slot's free. */
+        size_t  plen;    /* Length of prefix. */
+        int     values;  /* Nonzero to send values, too. */
+        char   *q;       /* Queued notifications, WATCHQLEN bytes. */
+        size_t  qoff;    /* Start of unsent notifications in q. */
+        size_t  qlen;    /* End of unsent notifications in q. */
+};
+
+static struct watcher watchers[MAXWATCHERS];
+static int            nwatchers; /* Slots in use. */
+
+/* drop_watcher closes w's socket, optionally sending msg first, and frees its
+ * slot. */
+static void
+drop_watcher(struct watcher *w, const char *msg)
+{
+        TRACE(close, w->op, w->plen, 0);
+        if (NULL != msg)
+                send(w->fd, msg, strlen(msg), MSG_DONTWAIT);
+        close(w->fd);
+        if (NULL != w->q) {
+                explicit_bzero(w->q, WATCHQLEN);
+                FREE(w->q);
+        }
+        FREE(w->prefix);
+        explicit_bzero(w, sizeof(*w));
+        --nwatchers;
+}
+
+/* flush sends as many of w's queued notifications as it can without
+ * blocking.  It returns -1 if w should be dropped. */
+static int
+flush(struct watcher *w)
+{
+        ssize_t nw;
+
+        for (; w->qoff < w->qlen; w->qoff += nw) {
+                nw = send(w->fd, w->q + w->qoff, w->qlen - w->qoff,
+                                MSG_DONTWAIT);
+                if (-1 == nw) {
+                        if (EAGAIN == errno || EINTR == errno)
+                                return 0;
+                        warn("send (notification)");
+                        return -1;
+                }
+        }
+
+        /* All sent, start again at the beginning.  The first time, that
+         * includes the Watching line, which is the reply to the request. */
+        if (!w->replied) {
+                TRACE(reply, w->op, w->plen, 0);
+                w->replied = 1;
+        }
+        explicit_bzero(w->q, w->qlen);
+        w->qoff = w->qlen = 0;
+        return 0;
+}
+
+/* enqueue adds n bytes from p to w's queue, which must have room. */
+static void
+enqueue(struct watcher *w, const char *p, size_t n)
+{
+        memcpy(w->q + w->qlen, p, n);
+        w->qlen += n;
+}
+
+/* watch_add makes c a watcher of keys starting with the plen-byte prefix,
+ * with values if values is nonzero, and tells it the current version.  On
+ * success, c belongs to the watcher code.  It returns -1 if there's no room
+ * for another watcher. */
+int
+watch_add(int c, const char *prefix, size_t plen, int values,
+                unsigned long long version)
+{
+        struct watcher *w;
+        int i;
+
+        /* Find a free slot. */
+        for (i = 0; i < MAXWATCHERS && NULL != watchers[i].prefix; ++i)
+                ;
+        if (MAXWATCHERS == i)
+                return -1;
+        w = &watchers[i];
+
+        if (NULL == (w->prefix = malloc(plen + 1))) {
+                warn("malloc");
+                return -1;
+        }
+        memcpy(w->prefix, prefix, plen);
+        w->prefix[plen] = '\0';
+        if (NULL == (w->q = malloc(WATCHQLEN))) {
+                warn("malloc");
+                FREE(w->prefix);
+                return -1;
+        }
+        w->plen = plen;
+        w->fd = c;
+        w->op = values ? OP_WATCHV : OP_WATCH;
+        w->values = values;
+        ++nwatchers;
+
+        /* Let the watcher know we're watching and where we're starting,
+         * without blocking. */
+        w->qlen = snprintf(w->q, WATCHQLEN, "Watching %s at version %llu\n",
+                        w->prefix, version);
+        if (-1 == flush(w))
+                drop_watcher(w, NULL);
+        return 0;
+}
+
+/* watch_notify queues a notification for everybody watching key, which is
+ * klen bytes long, and sends as much as it can without blocking.  The op is
+ * OP_SET or OP_DEL.  For OP_SET, value is the new value and is vlen bytes
+ * long; for OP_DEL, it's NULL. */
+void
+watch_notify(char op, const char *key, size_t klen, const char *value,
+                size_t vlen, unsigned long long version)
+{
+        struct watcher *w;
+        char hdr[32], vhdr[32];
+        int hlen, vhlen;
+        size_t need;
+        int i;
+
+        /* This is on every set and delete, so be quick if nobody's
+         * watching. */
+        if (0 == nwatchers)
+                return;
+
+        hlen = vhlen = -1;
+        for (i = 0; i < MAXWATCHERS; ++i) {
+                w = &watchers[i];
+                if (NULL == w->prefix || klen < w->plen ||
+                                0 != memcmp(key, w->prefix, w->plen))
+                        continue;
+
+                /* Notifications look like "s 42 key\n", or with the value,
+                 * "s 42 key 5\nvalue\n". */
+                if (-1 == hlen) {
+                        hlen = snprintf(hdr, sizeof(hdr), "%c %llu ", op,
+                                        version);
+                        vhlen = snprintf(vhdr, sizeof(vhdr), " %zu\n", vlen);
+                }
+
+                /* Make sure we've room for it. */
+                need = hlen + klen + 1;
+                if (w->values && NULL != value)
+                        need += vhlen - 1 + vlen + 1;
+                if (WATCHQLEN - w->qlen < need && 0 != w->qoff) {
+                        memmove(w->q, w->q + w->qoff, w->qlen - w->qoff);
+                        w->qlen -= w->qoff;
+                        explicit_bzero(w->q + w->qlen, w->qoff);
+                        w->qoff = 0;
+                }
+                if (WATCHQLEN - w->qlen < need) {
+                        warnx("watcher too far behind, dropping");
+                        drop_watcher(w, SLOWMSG);
+                        continue;
+                }
+
+                /* Queue it and send what we can. */
+                enqueue(w, hdr, hlen);
+                enqueue(w, key, klen);
+                if (w->values && NULL != value) {
+                        enqueue(w, vhdr, vhlen);
+                        enqueue(w, value, vlen);
+                }
+                enqueue(w, "\n", 1);
+                if (-1 == flush(w))
+                        drop_watcher(w, NULL);
+        }
+}
+
+/* watch_pollfds fills in MAXWATCHERS pollfds for the watchers. */
+void
+watch_pollfds(struct pollfd *pfds)
+{
+        int i;
+
+        for (i = 0; i < MAXWATCHERS; ++i) {
+                pfds[i].fd = NULL == watchers[i].prefix ? -1 : watchers[i].fd;
+                pfds[i].events = POLLIN;
+                if (watchers[i].qoff < watchers[i].qlen)
+                        pfds[i].events |= POLLOUT;
+        }
+}
+
+/* watch_service sends queued notifications and notices hung-up watchers,
+ * after pfds, as filled in by watch_pollfds, has been polled. */
+void
+watch_service(struct pollfd *pfds)
+{
+        struct watcher *w;
+        char buf[64];
+        ssize_t nr;
+        int i;
+
+        for (i = 0; i < MAXWATCHERS; ++i) {
+                w = &watchers[i];
+                if (NULL == w->prefix || 0 == pfds[i].revents)
+                        continue;
+
+                /* Watchers shouldn't have anything more to say, so anything
+                 * readable is probably a hangup. */
+                if (0 != (pfds[i].revents & ~POLLOUT)) {
+                        nr = recv(w->fd, buf, sizeof(buf), MSG_DONTWAIT);
+                        if (0 == nr || (-1 == nr && EAGAIN != errno &&
+                                                EINTR != errno)) {
+                                drop_watcher(w, NULL);
+                                continue;
+                        }
+                }
+
+                if (0 != (pfds[i].revents & POLLOUT) && -1 == flush(w))
+                        drop_watcher(w, NULL);
+        }
+}
@@ -0,0 +1,44 @@
+/*
+ * watch.h
+ * Tell watching clients about changed keys.
+ * By J. Stuart McMurray
+ * Created 20261019
+ * Last Modified 20261019
+ */
+
+#ifndef HAVE_WATCH_H
+#define HAVE_WATCH_H
+
+#include <poll.h>
+#include <stddef.h>
+
+/* MAXWATCHERS is the maximum number of clients which may watch at once. */
+#define MAXWATCHERS 256
+
+/* WATCHQLEN is the most notifications, in bytes, we'll queue for a watcher
+ * before giving up on it.  It's enough for at least one maximum-sized key and
+ * value. */
+#define WATCHQLEN (256 * 1024)
+
+/* watch_add makes c a watcher of keys starting with the plen-byte prefix,
+ * with values if values is nonzero, and tells it the current version.  On
+ * success, c belongs to the watcher code.  It returns -1 if there's no room
+ * for another watcher. */
+int watch_add(int c, const char *prefix, size_t plen, int values,
+                unsigned long long version);
+
+/* watch_notify queues a notification for everybody watching key, which is
+ * klen bytes long, and sends as much as it can without blocking.  The op is
+ * OP_SET or OP_DEL.  For OP_SET, value is the new value and is vlen bytes
+ * long; for OP_DEL, it's NULL. */
+void watch_notify(char op, const char *key, size_t klen, const char *value,
+                size_t vlen, unsigned long long version);
+
+/* watch_pollfds fills in MAXWATCHERS pollfds for the watchers. */
+void watch_pollfds(struct pollfd *pfds);
+
+/* watch_service sends queued notifications and notices hung-up watchers,
+ * after pfds, as filled in by watch_pollfds, has been polled. */
+void watch_service(struct pollfd *pfds);
+
+#endif /* #ifndef HAVE_WATCH_H */